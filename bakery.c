@@ -6,9 +6,18 @@
 #include <ctype.h>
 #include <stdbool.h>
 #include <stdint.h>
+#include <limits.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "bakery_stats.h"
+#include "bakery_ledger.h"
 
 #define MAX_NAME 20
 #define HASH_MAP_SIZE 307
+#define FEASIBILITY_ENTRIES 16 // Cached feasibility results kept per recipe
 
 typedef struct Batch {
     int expiration; // Batch expiration time
@@ -19,11 +28,19 @@ typedef struct Batch {
 typedef struct Ingredient {
     Batch *batches;   // List of batches for an ingredient
     char name[MAX_NAME];    // Ingredient name
+    unsigned int version;   // Bumped on every restock, consumption or expiry of its batches
+    int bulk_available;     // Stock not yet reserved by the bulk order being admitted, -1 outside of it
+    int bulk_demand;        // Quantity reserved by the bulk order being admitted
+    bool bulk_has_batches;  // Whether check_feasibility would still find batches at this point of the bulk order
+    struct Ingredient *bulk_next;  // Ingredients touched by the bulk order being admitted
     struct Ingredient *next;  // For collision handling (linked list)
 } Ingredient; // Linked list node
 
 typedef struct IngredientCatalog {
     Ingredient *buckets[HASH_MAP_SIZE];  // Array of pointers to batches
+    int ingredient_count;   // Ingredients in the warehouse
+    int batch_count;        // Batches stored over all ingredients
+    int expired_batches;    // Expired batches purged so far
 } IngredientCatalog;
 
 typedef struct RecipeIngredient {
@@ -32,14 +49,32 @@ typedef struct RecipeIngredient {
     struct RecipeIngredient *next;
 } RecipeIngredient;
 
+// Cached outcome of check_feasibility for an ordered quantity of a recipe
+typedef struct FeasibilityEntry {
+    int quantity;     // Ordered quantity the result was computed for
+    int result;       // Cached check_feasibility return code
+    unsigned long stamp;  // Sum of the recipe's ingredient versions when computed
+    int valid_until;  // First time at which a counted batch expires
+    struct FeasibilityEntry *next;
+} FeasibilityEntry;
+
 typedef struct Recipe {
     char name[MAX_NAME];    // Recipe name
     RecipeIngredient *required_ingredients; // List of ingredients needed for the recipe
+    FeasibilityEntry *feasibility; // At most FEASIBILITY_ENTRIES cached results, most recently used first
+    int ledger_id;          // Recipe id in the delivery ledger, -1 until its first delivery is recorded
     struct Recipe *next;
 } Recipe;
 
+typedef struct {
+    unsigned long hits;   // Lookups answered from the cache
+    unsigned long misses; // Lookups that had to walk the batches
+} FeasibilityCache;
+
 typedef struct {
     Recipe *recipes[HASH_MAP_SIZE]; // hash table of recipes
+    FeasibilityCache feasibility;   // memoized check_feasibility results
+    int recipe_count;               // Recipes in the catalog
 } RecipeCatalog;
 
 typedef struct {
@@ -60,28 +95,65 @@ typedef struct Node {
 typedef struct {
     Node* front;  // Pointer to node at front of queue (first element)
     Node* rear;   // Pointer to node at end of queue (last element)
+    int length;   // Number of nodes in the queue
 } Queue;
 
+// Recipe name already in the ledger recipes file, a name keeps its id across runs
+typedef struct LedgerName {
+    char name[MAX_NAME];
+    int id;
+    struct LedgerName *next;
+} LedgerName;
+
+// Memory mapped delivery ledger, a new segment file every LEDGER_SEGMENT_RECORDS deliveries
+typedef struct {
+    char dir[256];            // Ledger directory, created on the first delivery
+    int segment_number;       // Number of the mapped segment
+    LedgerHeader *segment;    // Mapped segment, NULL before the first delivery
+    FILE *recipes;            // Recipe names file, NULL before the first delivery
+    LedgerName *names[HASH_MAP_SIZE]; // Ids of the names in the recipes file
+    int next_id;              // Ledger id of the next name delivered for the first time
+    int run;                  // Number of this run, one more than the run of the last segment
+    bool failed;              // A segment couldn't be created, stop writing the ledger
+} Ledger;
+
 // Function declarations
 IngredientCatalog* init_ingredient_map();
 RecipeCatalog* init_recipe_catalog();
 unsigned int hash(char str[MAX_NAME]);
 void insert_batch(FILE *file, IngredientCatalog *map);
 void remove_batches(IngredientCatalog *map, RecipeCatalog *cat, Order *order, int current_time);
+void take_from_batches(IngredientCatalog *map, Ingredient *ing, int required_quantity, int current_time);
+Batch *purge_batch(IngredientCatalog *map, Ingredient *ing, Batch *prev, Batch *curr_batch, int current_time);
 Recipe* find_recipe(RecipeCatalog *cat, char name[MAX_NAME]);
 void add_recipe(FILE *file, RecipeCatalog *cat, IngredientCatalog *map);
 void remove_recipe(FILE *file, RecipeCatalog *cat, Queue *waiting_orders, Queue *ready_orders);
 void free_recipe_catalog(RecipeCatalog *cat, char recipe_name[MAX_NAME]);
 int check_feasibility(IngredientCatalog *map, RecipeCatalog *cat, Order *order, int current_time);
+int compute_feasibility(IngredientCatalog *map, Order *order, int current_time, int *valid_until);
+unsigned long recipe_stock_stamp(Recipe *recipe);
+void invalidate_feasibility(Recipe *recipe);
 void handle_order(IngredientCatalog *map, RecipeCatalog *cat, Queue *ready_orders, Queue *waiting_orders, Order *order, int current_time);
+void handle_bulk_order(FILE *file, IngredientCatalog *map, RecipeCatalog *cat, Queue *ready_orders, Queue *waiting_orders, int current_time);
+int available_quantity(IngredientCatalog *map, Ingredient *ing, int current_time);
 void check_restock(IngredientCatalog *map, RecipeCatalog *cat, Queue *ready_orders, Queue *waiting_orders, int current_time);
-void pickup(Queue *picked_orders, Queue *ready_orders, int capacity, RecipeCatalog *cat);
+void pickup(Queue *picked_orders, Queue *ready_orders, int capacity, RecipeCatalog *cat, Ledger *ledger, int current_time, int *loaded_orders, int *loaded_weight);
 int sum_quantities(RecipeCatalog *cat, Order *order);
 Order *init_order(FILE *file, int arrival_time, RecipeCatalog *cat);
 void enqueue_pickup(RecipeCatalog *cat, Queue* queue, Order *new_order);
 Queue* init_queue();
 void enqueue_ready(Queue *queue, Order *new_order, RecipeCatalog *cat);
 Ingredient *find_ingredient(IngredientCatalog *map, char name[MAX_NAME]);
+StatsSegment *open_stats_segment(const char *name);
+bool reclaim_stats_segment(const char *name);
+void publish_stats(StatsSegment *segment, IngredientCatalog *map, RecipeCatalog *cat, Queue *ready_orders, Queue *waiting_orders, int current_time, int loaded_orders, int loaded_weight);
+Ledger *open_ledger(const char *dir);
+int resume_ledger(Ledger *ledger);
+int last_ledger_run(Ledger *ledger);
+int ledger_recipe_id(Ledger *ledger, const char *name);
+int rotate_ledger(Ledger *ledger);
+void ledger_append(Ledger *ledger, Order *order, int weight, int pickup_time);
+void close_ledger(Ledger *ledger);
 
 // Split the list into two parts
 void split_list(Node *source, Node **front, Node **back) {
@@ -176,6 +248,9 @@ IngredientCatalog *init_ingredient_map() {
     for (int i = 0; i < HASH_MAP_SIZE; i++) {
         map->buckets[i] = NULL;
     }
+    map->ingredient_count = 0;
+    map->batch_count = 0;
+    map->expired_batches = 0;
     return map;
 }
 
@@ -193,11 +268,15 @@ void insert_batch(FILE *file, IngredientCatalog *map) {
         new_batch->expiration = expiration;
         new_batch->quantity = quantity;
         new_batch->next = NULL;
+        map->batch_count++;
         // Insert the new batch in the linked list in ascending order of expiration
         if (map->buckets[index] == NULL) {
             map->buckets[index] = (Ingredient *)malloc(sizeof(Ingredient));
             strcpy(map->buckets[index]->name, ingredient_name);
             map->buckets[index]->batches = new_batch;
+            map->buckets[index]->version = 0;
+            map->buckets[index]->bulk_available = -1;
+            map->ingredient_count++;
             map->buckets[index]->next = NULL;
         }
         else{
@@ -211,10 +290,14 @@ void insert_batch(FILE *file, IngredientCatalog *map) {
                 Ingredient *new_ingredient = (Ingredient *)malloc(sizeof(Ingredient));
                 strcpy(new_ingredient->name, ingredient_name);
                 new_ingredient->batches = new_batch;
+                new_ingredient->version = 0;
+                new_ingredient->bulk_available = -1;
+                map->ingredient_count++;
                 new_ingredient->next = map->buckets[index];
                 map->buckets[index] = new_ingredient;
             } 
             else {
+                curr->version++;
                 Batch *curr_batch = curr->batches;
                 Batch *prev = NULL;
                 while (curr_batch != NULL && curr_batch->expiration < expiration) {
@@ -225,6 +308,7 @@ void insert_batch(FILE *file, IngredientCatalog *map) {
                 if (curr_batch != NULL && curr_batch->expiration == expiration) {
                     curr_batch->quantity += quantity;
                     free(new_batch);
+                    map->batch_count--;
                 } else {
                     if (prev) {
                         prev->next = new_batch;
@@ -249,64 +333,60 @@ unsigned int hash(char str[MAX_NAME]) {
     return hash % HASH_MAP_SIZE;
 }
 
+// Unlink and free a batch that is expired or empty, return the batch that followed it
+Batch *purge_batch(IngredientCatalog *map, Ingredient *ing, Batch *prev, Batch *curr_batch, int current_time) {
+    Batch *next = curr_batch->next;
+    if (prev) {
+        prev->next = next;
+    } else {
+        ing->batches = next;
+    }
+    ing->version++;
+    if (curr_batch->expiration <= current_time) {
+        map->expired_batches++;
+    }
+    map->batch_count--;
+    free(curr_batch);
+    return next;
+}
+
+// Remove required_quantity from the batches of an ingredient, earliest expiration first
+void take_from_batches(IngredientCatalog *map, Ingredient *ing, int required_quantity, int current_time) {
+    ing->version++;
+    Batch *curr_batch = ing->batches;
+    Batch *prev = NULL;
+    while(curr_batch != NULL && required_quantity > 0){
+        // remove if batch is expired OR has zero quantity
+        if(curr_batch->expiration <= current_time || curr_batch->quantity == 0){
+            curr_batch = purge_batch(map, ing, prev, curr_batch, current_time);
+            continue;
+        }
+        // remove remaining required quantity
+        if(curr_batch->expiration > current_time && curr_batch->quantity >= required_quantity){
+            curr_batch->quantity -= required_quantity;
+            required_quantity = 0;
+            break;
+        } else if(curr_batch->expiration > current_time && curr_batch->quantity < required_quantity){
+            required_quantity -= curr_batch->quantity;
+            curr_batch->quantity = 0;
+            // free empty batch
+            curr_batch = purge_batch(map, ing, prev, curr_batch, current_time);
+            continue;
+        }
+        prev = curr_batch;
+        curr_batch = curr_batch->next;
+    }
+}
+
 void remove_batches(IngredientCatalog *map, RecipeCatalog *cat, Order *order, int current_time) {
     Recipe *recipe = order->recipe;
     RecipeIngredient *curr = recipe->required_ingredients;
     // iterate through ingredients needed for the recipe
     while(curr){
         int required_quantity = curr->quantity * order->quantity;
-        Ingredient *ing = curr->stock;
-        Ingredient *prev_ing = NULL;
-        // iterate through ingredients in warehouse to find the needed one among possible collisions
-        // ingredient in ing
-        Batch *curr_batch = ing->batches;
-        Batch *prev = NULL;
-        while(curr_batch != NULL && required_quantity > 0){
-            // remove if batch is expired OR has zero quantity
-            if(curr_batch->expiration <= current_time || curr_batch->quantity == 0){
-                Batch *temp = curr_batch;
-                if (prev) {
-                    prev->next = curr_batch->next;
-                } else {
-                    ing->batches = curr_batch->next;
-                }
-                curr_batch = curr_batch->next;
-                free(temp);
-                continue;
-            }
-            // remove remaining required quantity
-            if(curr_batch->expiration > current_time && curr_batch->quantity >= required_quantity){
-                curr_batch->quantity -= required_quantity;
-                required_quantity = 0;
-                break;
-            } else if(curr_batch->expiration > current_time && curr_batch->quantity < required_quantity){
-                required_quantity -= curr_batch->quantity;
-                curr_batch->quantity = 0;
-                // free empty batch
-                Batch *temp = curr_batch;
-                if (prev) {
-                    prev->next = curr_batch->next;
-                } else {
-                    ing->batches = curr_batch->next;
-                }
-                curr_batch = curr_batch->next;
-                free(temp);
-                continue;
-            }
-            prev = curr_batch;
-            curr_batch = curr_batch->next;
-        }
-    // check if ingredient has no more batches
-    if(ing->batches == NULL){
-        if(prev_ing){
-            prev_ing->next = ing->next;
-        } else {
-            unsigned int index = hash(ing->name);
-            map->buckets[index] = ing->next;
-        }
-        free(ing);
-    }
-    curr = curr->next;
+        // the ingredient stays in the warehouse even without batches, recipes point to it
+        take_from_batches(map, curr->stock, required_quantity, current_time);
+        curr = curr->next;
     }
 }
 
@@ -339,6 +419,7 @@ void enqueue_pickup(RecipeCatalog *cat, Queue *queue, Order *new_order){
     new_node->order = new_order;
     new_node->weight = sum_quantities(cat, new_order);
     new_node->next = NULL;
+    queue->length++;
     if (queue->rear == NULL || queue->front == NULL) {
         // Queue is empty, so both front and rear must point to the new node
         queue->front = new_node;
@@ -372,9 +453,11 @@ void enqueue_pickup(RecipeCatalog *cat, Queue *queue, Order *new_order){
 }
 
 // Pickup by truck
-void pickup(Queue *picked_orders, Queue *ready_orders, int capacity, RecipeCatalog *cat) {
+void pickup(Queue *picked_orders, Queue *ready_orders, int capacity, RecipeCatalog *cat, Ledger *ledger, int current_time, int *loaded_orders, int *loaded_weight) {
     int truck_empty = 1;
     int current_quantity = 0;
+    *loaded_orders = 0;
+    *loaded_weight = 0;
     Node* curr = ready_orders->front;
     Node* tmp; // free nodes
     while (curr) {
@@ -383,12 +466,15 @@ void pickup(Queue *picked_orders, Queue *ready_orders, int capacity, RecipeCatal
             break;
         }
         truck_empty = 0;
+        (*loaded_orders)++;
+        *loaded_weight += curr->weight;
         enqueue_pickup(cat, picked_orders, curr->order);
         // free node
         tmp = curr;
         ready_orders->front = curr->next;
         curr = curr->next;
         free(tmp);
+        ready_orders->length--;
     }
     // empty queue
     if(ready_orders->front == NULL) {
@@ -402,6 +488,9 @@ void pickup(Queue *picked_orders, Queue *ready_orders, int capacity, RecipeCatal
     // print picked_orders
     while (curr) {
         printf("%d %s %d\n",curr->order->arrival_time ,curr->order->recipe_name, curr->order->quantity);
+        // delivered, keep it in the ledger only
+        ledger_append(ledger, curr->order, curr->weight, current_time);
+        free(curr->order);
         tmp = curr;
         curr = curr->next;
         free(tmp);
@@ -409,6 +498,7 @@ void pickup(Queue *picked_orders, Queue *ready_orders, int capacity, RecipeCatal
     // empty picked_orders
     picked_orders->front = NULL;
     picked_orders->rear = NULL;
+    picked_orders->length = 0;
 }
 
 void remove_recipe(FILE *file, RecipeCatalog *cat, Queue *waiting_orders, Queue *ready_orders) {
@@ -455,7 +545,9 @@ void free_recipe_catalog(RecipeCatalog *cat, char recipe_name[MAX_NAME]) {
             } else {
                 cat->recipes[index] = curr->next;
             }
+            invalidate_feasibility(curr);
             free(curr);
+            cat->recipe_count--;
             return;
         }
         prev = curr;
@@ -482,6 +574,7 @@ void check_restock(IngredientCatalog *map, RecipeCatalog *cat, Queue *ready_orde
             }
             curr = curr->next;
             free(temp);
+            waiting_orders->length--;
         } else {
             prev = curr;
             curr = curr->next;
@@ -493,6 +586,7 @@ Queue* init_queue() {
     Queue* queue = (Queue*)malloc(sizeof(Queue));
     queue->front = NULL;
     queue->rear = NULL;
+    queue->length = 0;
     return queue;
 }
 
@@ -525,12 +619,193 @@ void handle_order(IngredientCatalog *map, RecipeCatalog *cat, Queue *ready_order
     return;
 }
 
+// Sum of the versions of every ingredient used by the recipe: versions only grow, so the sum changes iff some stock changed
+unsigned long recipe_stock_stamp(Recipe *recipe) {
+    unsigned long stamp = 0;
+    RecipeIngredient *curr = recipe->required_ingredients;
+    while (curr) {
+        stamp += curr->stock->version;
+        curr = curr->next;
+    }
+    return stamp;
+}
+
+// Drop cached results of a recipe that is being removed
+void invalidate_feasibility(Recipe *recipe) {
+    while (recipe->feasibility) {
+        FeasibilityEntry *temp = recipe->feasibility;
+        recipe->feasibility = temp->next;
+        free(temp);
+    }
+}
+
+// Sum of the non expired stock of an ingredient, purging expired and empty batches on the way
+int available_quantity(IngredientCatalog *map, Ingredient *ing, int current_time) {
+    int available = 0;
+    Batch *curr_batch = ing->batches;
+    Batch *prev = NULL;
+    while (curr_batch) {
+        if(curr_batch->expiration <= current_time || curr_batch->quantity == 0){
+            curr_batch = purge_batch(map, ing, prev, curr_batch, current_time);
+            continue;
+        }
+        available += curr_batch->quantity;
+        prev = curr_batch;
+        curr_batch = curr_batch->next;
+    }
+    return available;
+}
+
+// Admit n orders arriving at the same time, with the same outcome as n consecutive order commands
+void handle_bulk_order(FILE *file, IngredientCatalog *map, RecipeCatalog *cat, Queue *ready_orders, Queue *waiting_orders, int current_time) {
+    int n;
+    if (fscanf(file, "%d", &n) != 1 || n <= 0) {
+        return;
+    }
+    // last recipe resolved in each bucket, a repeated name costs one strcmp
+    Recipe *resolved[HASH_MAP_SIZE];
+    for (int k = 0; k < HASH_MAP_SIZE; k++) {
+        resolved[k] = NULL;
+    }
+    Ingredient *touched = NULL;
+    // admit orders in arrival order as they are read, stock is only reserved until the end of the group
+    for (int count = 0; count < n; count++) {
+        Order *order = (Order *)malloc(sizeof(Order));
+        if (fscanf(file, "%s %d", order->recipe_name, &order->quantity) != 2) {
+            free(order);
+            break;
+        }
+        order->arrival_time = current_time;
+        unsigned int index = hash(order->recipe_name);
+        if (resolved[index] && strcmp(resolved[index]->name, order->recipe_name) == 0) {
+            order->recipe = resolved[index];
+        } else {
+            order->recipe = find_recipe(cat, order->recipe_name);
+            if (order->recipe) {
+                resolved[index] = order->recipe;
+            }
+        }
+        if (order->recipe == NULL) {
+            printf("rejected\n");
+            free(order);
+            continue;
+        }
+        // same test as check_feasibility, stopping at the first ingredient that doesn't fit
+        int feasible = 1;
+        RecipeIngredient *curr = order->recipe->required_ingredients;
+        while (curr) {
+            Ingredient *ing = curr->stock;
+            if (ing->bulk_available < 0) {
+                // first time the group needs it: walk its batches once
+                ing->bulk_has_batches = ing->batches != NULL;
+                ing->bulk_available = available_quantity(map, ing, current_time);
+                ing->bulk_demand = 0;
+                ing->bulk_next = touched;
+                touched = ing;
+            }
+            int fits = ing->bulk_has_batches && ing->bulk_available >= curr->quantity * order->quantity;
+            // a check leaves the batch list empty unless some live stock is left
+            ing->bulk_has_batches = ing->bulk_available > 0;
+            if (!fits) {
+                feasible = 0;
+                break;
+            }
+            curr = curr->next;
+        }
+        if (feasible) {
+            curr = order->recipe->required_ingredients;
+            while (curr) {
+                int required_quantity = curr->quantity * order->quantity;
+                curr->stock->bulk_available -= required_quantity;
+                curr->stock->bulk_demand += required_quantity;
+                // consuming keeps the batch it stopped at, even once emptied
+                if (required_quantity > 0) {
+                    curr->stock->bulk_has_batches = true;
+                }
+                curr = curr->next;
+            }
+            enqueue_ready(ready_orders, order, cat);
+        } else {
+            enqueue_ready(waiting_orders, order, cat);
+        }
+        printf("accepted\n");
+    }
+    // consume the summed demand of the ready orders
+    while (touched) {
+        Ingredient *ing = touched;
+        if (ing->bulk_demand > 0) {
+            take_from_batches(map, ing, ing->bulk_demand, current_time);
+        }
+        if (!ing->bulk_has_batches) {
+            // a later check of the group emptied the list, only emptied batches are left
+            available_quantity(map, ing, current_time);
+        }
+        ing->bulk_available = -1;
+        touched = ing->bulk_next;
+        ing->bulk_next = NULL;
+    }
+}
+
 int check_feasibility(IngredientCatalog *map, RecipeCatalog *cat, Order *order, int current_time) {
     // return 0 if order is feasible and goes to waiting, 1 if order is feasible and goes to ready, 2 if order is not feasible
     Recipe *recipe = order->recipe;
     if (!recipe) {
         return 2;
     }
+    FeasibilityCache *cache = &cat->feasibility;
+    FeasibilityEntry *entry = recipe->feasibility;
+    FeasibilityEntry *prev = NULL;
+    FeasibilityEntry *before_last = NULL;
+    int entries = 0;
+    while (entry && entry->quantity != order->quantity) {
+        before_last = prev;
+        prev = entry;
+        entry = entry->next;
+        entries++;
+    }
+    if (entry) {
+        // move to front, the list is kept in most recently used order
+        if (prev) {
+            prev->next = entry->next;
+            entry->next = recipe->feasibility;
+            recipe->feasibility = entry;
+        }
+        // cached result is still valid if no ingredient changed and no counted batch expired since
+        if (current_time < entry->valid_until && entry->stamp == recipe_stock_stamp(recipe)) {
+            cache->hits++;
+            return entry->result;
+        }
+    } else if (entries == FEASIBILITY_ENTRIES) {
+        // list full, reuse the least recently used entry
+        entry = prev;
+        if (before_last) {
+            before_last->next = NULL;
+            entry->next = recipe->feasibility;
+            recipe->feasibility = entry;
+        }
+        entry->quantity = order->quantity;
+    } else {
+        entry = (FeasibilityEntry *)malloc(sizeof(FeasibilityEntry));
+        entry->quantity = order->quantity;
+        entry->next = recipe->feasibility;
+        recipe->feasibility = entry;
+    }
+    cache->misses++;
+    int valid_until;
+    int result = compute_feasibility(map, order, current_time, &valid_until);
+    entry->result = result;
+    entry->valid_until = valid_until;
+    // stamp taken after the walk, which may have purged expired batches
+    entry->stamp = recipe_stock_stamp(recipe);
+    return result;
+}
+
+// Walk the batches of every required ingredient, valid_until is set to the first expiration among counted batches
+int compute_feasibility(IngredientCatalog *map, Order *order, int current_time, int *valid_until) {
+    Recipe *recipe = order->recipe;
+    // an unfeasible order stays unfeasible until some stock changes
+    *valid_until = INT_MAX;
+    int earliest = INT_MAX;
     RecipeIngredient *curr = recipe->required_ingredients;
     while (curr) {
         Ingredient *ing = curr->stock;
@@ -543,19 +818,12 @@ int check_feasibility(IngredientCatalog *map, RecipeCatalog *cat, Order *order,
         while (curr_batch) {
             // remove if batch is expired OR has zero quantity
             if(curr_batch->expiration <= current_time || curr_batch->quantity == 0){
-                Batch *temp = curr_batch;
-                if (prev) {
-                    prev->next = curr_batch->next;
-                } else {
-                    ing->batches = curr_batch->next;
-                }
-                curr_batch = curr_batch->next;
-                if(temp){
-                    free(temp);
-                    temp = NULL;
-                }
+                curr_batch = purge_batch(map, ing, prev, curr_batch, current_time);
                 continue;
             }
+            if (curr_batch->expiration < earliest) {
+                earliest = curr_batch->expiration;
+            }
             // batch contains all required quantity
             if(curr_batch->quantity >= required_quantity){
                 required_quantity = 0;
@@ -573,6 +841,7 @@ int check_feasibility(IngredientCatalog *map, RecipeCatalog *cat, Order *order,
         }
         curr = curr->next;
     }
+    *valid_until = earliest;
     return 1;
 }
 
@@ -582,6 +851,7 @@ void enqueue_ready(Queue *queue, Order *new_order, RecipeCatalog *cat) {
     new_node->order = new_order;
     new_node->weight = sum_quantities(cat, new_order);
     new_node->next = NULL;
+    queue->length++;
     // empty queue
     if (queue->front == NULL || queue->rear == NULL){
         queue->front = new_node;
@@ -600,6 +870,9 @@ RecipeCatalog* init_recipe_catalog() {
     for(int i = 0; i < HASH_MAP_SIZE; i++){
         cat->recipes[i] = NULL;
     }
+    cat->feasibility.hits = 0;
+    cat->feasibility.misses = 0;
+    cat->recipe_count = 0;
     return cat;
 }
 
@@ -633,6 +906,8 @@ void add_recipe(FILE *file, RecipeCatalog *cat, IngredientCatalog *map) {
     Recipe *new_recipe = (Recipe*)malloc(sizeof(Recipe));
     strcpy(new_recipe->name, recipe_name);
     new_recipe->required_ingredients = NULL;
+    new_recipe->feasibility = NULL;
+    new_recipe->ledger_id = -1;
     // initialize ingredients
     int quantity;
     char terminator = '0';
@@ -656,6 +931,9 @@ void add_recipe(FILE *file, RecipeCatalog *cat, IngredientCatalog *map) {
                 Ingredient *new_ingredient_map = (Ingredient *)malloc(sizeof(Ingredient));
                 strcpy(new_ingredient_map->name, ingredient);
                 new_ingredient_map->batches = NULL;
+                new_ingredient_map->version = 0;
+                new_ingredient_map->bulk_available = -1;
+                map->ingredient_count++;
                 new_ingredient_map->next = map->buckets[index];
                 map->buckets[index] = new_ingredient_map;
                 new_ingredient->stock = new_ingredient_map;
@@ -687,9 +965,303 @@ void add_recipe(FILE *file, RecipeCatalog *cat, IngredientCatalog *map) {
             curr->next = new_recipe;
             curr->next->next = NULL;
         }
+    cat->recipe_count++;
     printf("added\n");
 }
 
+// Create the shared memory segment read by bakery-top, NULL if another engine owns it or it can't be mapped
+StatsSegment *open_stats_segment(const char *name) {
+    int fd = shm_open(name, O_CREAT | O_EXCL | O_RDWR, 0644);
+    if (fd < 0 && errno == EEXIST && reclaim_stats_segment(name)) {
+        fd = shm_open(name, O_CREAT | O_EXCL | O_RDWR, 0644);
+    }
+    if (fd < 0) {
+        fprintf(stderr, "stats segment %s not created, running without live stats\n", name);
+        return NULL;
+    }
+    if (ftruncate(fd, sizeof(StatsSegment)) != 0) {
+        close(fd);
+        shm_unlink(name);
+        return NULL;
+    }
+    StatsSegment *segment = (StatsSegment *)mmap(NULL, sizeof(StatsSegment), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (segment == MAP_FAILED) {
+        shm_unlink(name);
+        return NULL;
+    }
+    memset(segment, 0, sizeof(StatsSegment));
+    segment->owner = getpid();
+    segment->magic = STATS_MAGIC;
+    return segment;
+}
+
+// Unlink a segment left by an engine that was killed, true if the name is free again
+bool reclaim_stats_segment(const char *name) {
+    int fd = shm_open(name, O_RDONLY, 0);
+    if (fd < 0) {
+        return errno == ENOENT;
+    }
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size < (off_t)sizeof(StatsSegment)) {
+        // still being created by another engine
+        close(fd);
+        return false;
+    }
+    StatsSegment *segment = (StatsSegment *)mmap(NULL, sizeof(StatsSegment), PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (segment == MAP_FAILED) {
+        return false;
+    }
+    bool stale = segment->magic == STATS_MAGIC && !stats_owner_alive(segment);
+    int owner = segment->owner;
+    munmap(segment, sizeof(StatsSegment));
+    if (!stale) {
+        return false;
+    }
+    fprintf(stderr, "stats segment %s left by engine %d, reclaimed\n", name, owner);
+    return shm_unlink(name) == 0 || errno == ENOENT;
+}
+
+// Copy the counters kept by the catalogs and queues to the segment
+void publish_stats(StatsSegment *segment, IngredientCatalog *map, RecipeCatalog *cat, Queue *ready_orders, Queue *waiting_orders, int current_time, int loaded_orders, int loaded_weight) {
+    if (segment == NULL) {
+        return;
+    }
+    BakeryStats stats;
+    stats.command = current_time;
+    stats.waiting_orders = waiting_orders->length;
+    stats.ready_orders = ready_orders->length;
+    stats.batches = map->batch_count;
+    stats.expired_batches = map->expired_batches;
+    stats.recipes = cat->recipe_count;
+    stats.ingredients = map->ingredient_count;
+    stats.last_pickup_orders = loaded_orders;
+    stats.last_pickup_weight = loaded_weight;
+    stats_publish(segment, &stats);
+}
+
+// Ledger appending to dir, nothing is touched on disk before the first delivery
+Ledger *open_ledger(const char *dir) {
+    Ledger *ledger = (Ledger *)malloc(sizeof(Ledger));
+    snprintf(ledger->dir, sizeof(ledger->dir), "%s", dir);
+    ledger->segment_number = -1;
+    ledger->segment = NULL;
+    ledger->recipes = NULL;
+    for (int k = 0; k < HASH_MAP_SIZE; k++) {
+        ledger->names[k] = NULL;
+    }
+    ledger->next_id = 0;
+    ledger->run = 0;
+    ledger->failed = false;
+    return ledger;
+}
+
+// Pick up the ledger left by previous runs: names keep the id they were given,
+// and this run writes its own segments after the last existing one so each segment stays sorted by pickup time
+int resume_ledger(Ledger *ledger) {
+    char path[300];
+    char name[MAX_NAME];
+    int id;
+    mkdir(ledger->dir, 0755);
+    snprintf(path, sizeof(path), "%s/%s", ledger->dir, LEDGER_RECIPES_FILE);
+    ledger->recipes = fopen(path, "a+");
+    if (ledger->recipes == NULL) {
+        return 0;
+    }
+    // one line per name, the file only grows with names never delivered before
+    rewind(ledger->recipes);
+    while (fscanf(ledger->recipes, "%d %19s", &id, name) == 2) {
+        if (id < 0) {
+            continue;
+        }
+        unsigned int index = hash(name);
+        LedgerName *entry = (LedgerName *)malloc(sizeof(LedgerName));
+        strcpy(entry->name, name);
+        entry->id = id;
+        entry->next = ledger->names[index];
+        ledger->names[index] = entry;
+        if (id >= ledger->next_id) {
+            ledger->next_id = id + 1;
+        }
+    }
+    // switching from reading to appending needs a positioning call
+    fseek(ledger->recipes, 0, SEEK_END);
+    // segments are numbered without gaps: double the probe until a number is free, then bisect
+    struct stat st;
+    int present = -1;
+    int absent = 0;
+    ledger_segment_path(path, sizeof(path), ledger->dir, absent);
+    while (stat(path, &st) == 0) {
+        present = absent;
+        absent = absent * 2 + 1;
+        ledger_segment_path(path, sizeof(path), ledger->dir, absent);
+    }
+    while (absent - present > 1) {
+        int mid = present + (absent - present) / 2;
+        ledger_segment_path(path, sizeof(path), ledger->dir, mid);
+        if (stat(path, &st) == 0) {
+            present = mid;
+        } else {
+            absent = mid;
+        }
+    }
+    ledger->segment_number = present;
+    ledger->run = last_ledger_run(ledger) + 1;
+    return 1;
+}
+
+// Run of the last valid segment, -1 if there is none
+int last_ledger_run(Ledger *ledger) {
+    char path[300];
+    for (int number = ledger->segment_number; number >= 0; number--) {
+        ledger_segment_path(path, sizeof(path), ledger->dir, number);
+        int fd = open(path, O_RDONLY);
+        if (fd < 0) {
+            continue;
+        }
+        struct stat st;
+        int run = -1;
+        if (fstat(fd, &st) == 0 && st.st_size >= (off_t)sizeof(LedgerHeader)) {
+            LedgerHeader *header = (LedgerHeader *)mmap(NULL, sizeof(LedgerHeader), PROT_READ, MAP_SHARED, fd, 0);
+            if (header != MAP_FAILED) {
+                if (header->magic == LEDGER_MAGIC) {
+                    run = header->run;
+                }
+                munmap(header, sizeof(LedgerHeader));
+            }
+        }
+        close(fd);
+        // a segment left without its magic by a killed engine doesn't count
+        if (run >= 0) {
+            return run;
+        }
+    }
+    return -1;
+}
+
+// Id of a recipe name, given and appended to the recipes file the first time the name is delivered
+int ledger_recipe_id(Ledger *ledger, const char *name) {
+    unsigned int index = hash((char *)name);
+    for (LedgerName *entry = ledger->names[index]; entry; entry = entry->next) {
+        if (strcmp(entry->name, name) == 0) {
+            return entry->id;
+        }
+    }
+    LedgerName *entry = (LedgerName *)malloc(sizeof(LedgerName));
+    strcpy(entry->name, name);
+    entry->id = ledger->next_id++;
+    entry->next = ledger->names[index];
+    ledger->names[index] = entry;
+    fprintf(ledger->recipes, "%d %s\n", entry->id, entry->name);
+    fflush(ledger->recipes);
+    return entry->id;
+}
+
+// Unmap the full segment and map the next one, return 0 if it can't be created
+int rotate_ledger(Ledger *ledger) {
+    char path[300];
+    if (ledger->segment) {
+        munmap(ledger->segment, ledger_segment_size(LEDGER_SEGMENT_RECORDS, LEDGER_RECIPE_SLOTS));
+        ledger->segment = NULL;
+    }
+    size_t size = ledger_segment_size(LEDGER_SEGMENT_RECORDS, LEDGER_RECIPE_SLOTS);
+    ledger_segment_path(path, sizeof(path), ledger->dir, ledger->segment_number + 1);
+    // never reuse a segment number, a partial file is removed so readers don't stop at it
+    int fd = open(path, O_CREAT | O_EXCL | O_RDWR, 0644);
+    if (fd < 0) {
+        return 0;
+    }
+    if (ftruncate(fd, size) != 0) {
+        close(fd);
+        unlink(path);
+        return 0;
+    }
+    LedgerHeader *segment = (LedgerHeader *)mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (segment == MAP_FAILED) {
+        unlink(path);
+        return 0;
+    }
+    segment->capacity = LEDGER_SEGMENT_RECORDS;
+    segment->slots = LEDGER_RECIPE_SLOTS;
+    segment->run = ledger->run;
+    LedgerSlot *slots = ledger_slots(segment);
+    for (int k = 0; k < LEDGER_RECIPE_SLOTS; k++) {
+        slots[k].recipe_id = -1;
+    }
+    // magic last: a segment is only valid once its layout is written
+    segment->magic = LEDGER_MAGIC;
+    ledger->segment_number++;
+    ledger->segment = segment;
+    return 1;
+}
+
+// Record a delivered order, a store in the mapped segment: the kernel writes it back
+void ledger_append(Ledger *ledger, Order *order, int weight, int pickup_time) {
+    if (ledger == NULL || ledger->failed) {
+        return;
+    }
+    if (ledger->segment == NULL || atomic_load_explicit(&ledger->segment->count, memory_order_relaxed) == ledger->segment->capacity) {
+        if ((ledger->recipes == NULL && !resume_ledger(ledger)) || !rotate_ledger(ledger)) {
+            fprintf(stderr, "delivery ledger in %s stopped, segment %d can't be created\n", ledger->dir, ledger->segment_number + 1);
+            ledger->failed = true;
+            return;
+        }
+    }
+    Recipe *recipe = order->recipe;
+    if (recipe->ledger_id < 0) {
+        recipe->ledger_id = ledger_recipe_id(ledger, recipe->name);
+    }
+    LedgerHeader *header = ledger->segment;
+    // the engine is the only writer of count
+    int32_t index = atomic_load_explicit(&header->count, memory_order_relaxed);
+    LedgerRecord *record = &ledger_records(header)[index];
+    record->pickup_time = pickup_time;
+    record->arrival_time = order->arrival_time;
+    record->recipe_id = recipe->ledger_id;
+    record->quantity = order->quantity;
+    record->weight = weight;
+    record->prev_recipe = -1;
+    // chain the record to the previous delivery of the same recipe
+    LedgerSlot *slot = ledger_find_slot(header, recipe->ledger_id);
+    if (slot) {
+        if (slot->recipe_id == recipe->ledger_id) {
+            record->prev_recipe = slot->last;
+        }
+        slot->recipe_id = recipe->ledger_id;
+        slot->last = index;
+    } else {
+        header->overflow = 1;
+    }
+    if (index == 0) {
+        header->first_pickup = pickup_time;
+    }
+    header->last_pickup = pickup_time;
+    // publish the record: a reader that sees the new count sees everything written above
+    atomic_store_explicit(&header->count, index + 1, memory_order_release);
+}
+
+void close_ledger(Ledger *ledger) {
+    if (ledger == NULL) {
+        return;
+    }
+    if (ledger->segment) {
+        munmap(ledger->segment, ledger_segment_size(LEDGER_SEGMENT_RECORDS, LEDGER_RECIPE_SLOTS));
+    }
+    if (ledger->recipes) {
+        fclose(ledger->recipes);
+    }
+    for (int k = 0; k < HASH_MAP_SIZE; k++) {
+        while (ledger->names[k]) {
+            LedgerName *temp = ledger->names[k];
+            ledger->names[k] = temp->next;
+            free(temp);
+        }
+    }
+    free(ledger);
+}
+
 int main() {
     FILE* file = stdin;
     if (file == NULL) {
@@ -702,17 +1274,28 @@ int main() {
     Queue* ready_orders = init_queue();
     Queue* waiting_orders = init_queue();
     Queue* picked_orders = init_queue();
+    // delivery ledger, created on the first pickup, pickups are only printed if it can't be written
+    const char *ledger_dir = getenv("BAKERY_LEDGER");
+    if (ledger_dir == NULL) {
+        ledger_dir = LEDGER_DIR;
+    }
+    Ledger *ledger = open_ledger(ledger_dir);
     // data reading
     int periodicity, capacity;    
     if(fscanf(file, "%u %u", &periodicity, &capacity) != 2){
         return 0;
     }
+    // live stats only when a segment name is given, the engine runs without them if it can't be created
+    const char *stats_name = getenv("BAKERY_STATS_SHM");
+    StatsSegment *segment = stats_name ? open_stats_segment(stats_name) : NULL;
+    int loaded_orders = 0;
+    int loaded_weight = 0;
     int i = 0;
     char command[MAX_NAME];
     while (fscanf(file,"%s", command) == 1){
         if (i % periodicity == 0 && i != 0){
             sort_queue_by_arrival_time(ready_orders);
-            pickup(picked_orders, ready_orders, capacity, cat);
+            pickup(picked_orders, ready_orders, capacity, cat, ledger, i, &loaded_orders, &loaded_weight);
         }
         if (strcmp(command, "add_recipe") == 0) {
             add_recipe(file, cat, map);
@@ -723,18 +1306,30 @@ int main() {
             check_restock(map, cat, ready_orders, waiting_orders, i);
         } else if (strcmp(command, "order") == 0) {
             handle_order(map, cat, ready_orders, waiting_orders, init_order(file, i, cat), i);
+        } else if (strcmp(command, "bulk_order") == 0) {
+            handle_bulk_order(file, map, cat, ready_orders, waiting_orders, i);
         } else {
             printf("Unrecognized command: %s\n", command);
         }
         i++;
+        publish_stats(segment, map, cat, ready_orders, waiting_orders, i, loaded_orders, loaded_weight);
     }
     if (i % periodicity == 0 && i != 0){
-        pickup(picked_orders, ready_orders, capacity, cat);
+        pickup(picked_orders, ready_orders, capacity, cat, ledger, i, &loaded_orders, &loaded_weight);
+        publish_stats(segment, map, cat, ready_orders, waiting_orders, i, loaded_orders, loaded_weight);
+    }
+    if (getenv("BAKERY_CACHE_STATS")) {
+        fprintf(stderr, "feasibility cache: %lu hits, %lu misses\n", cat->feasibility.hits, cat->feasibility.misses);
     }
     // free everything
     free_queue(ready_orders);
     free_queue(waiting_orders);
     free_queue(picked_orders);
+    close_ledger(ledger);
+    if (segment) {
+        munmap(segment, sizeof(StatsSegment));
+        shm_unlink(stats_name);
+    }
     fclose(file);
     return 0;
 }
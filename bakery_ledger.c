@@ -0,0 +1,236 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "bakery_ledger.h"
+
+#define MAX_NAME 20
+
+// Recipe names indexed by recipe id, loaded from the ledger recipes file
+typedef struct {
+    char (*names)[MAX_NAME];
+    int size;
+} RecipeNames;
+
+void load_recipe_names(const char *dir, RecipeNames *recipes) {
+    char path[300];
+    char name[MAX_NAME];
+    int id;
+    recipes->names = NULL;
+    recipes->size = 0;
+    snprintf(path, sizeof(path), "%s/%s", dir, LEDGER_RECIPES_FILE);
+    FILE *file = fopen(path, "r");
+    if (file == NULL) {
+        return;
+    }
+    while (fscanf(file, "%d %19s", &id, name) == 2) {
+        if (id < 0) {
+            continue;
+        }
+        if (id >= recipes->size) {
+            int size = id + 1;
+            recipes->names = realloc(recipes->names, size * sizeof(*recipes->names));
+            memset(recipes->names[recipes->size], 0, (size - recipes->size) * sizeof(*recipes->names));
+            recipes->size = size;
+        }
+        strcpy(recipes->names[id], name);
+    }
+    fclose(file);
+}
+
+// A segment mapped read only, header is NULL if the file is missing or not a valid segment
+typedef struct {
+    LedgerHeader *header;
+    size_t size;      // Mapped bytes
+    uint32_t count;   // Records published when the segment was mapped, the engine may still be appending
+    int missing;      // No file with this number, past the last segment
+} MappedSegment;
+
+// Map a segment read only, rejecting files too short for the layout their header declares
+MappedSegment map_segment(const char *dir, int number) {
+    char path[300];
+    MappedSegment mapped = { NULL, 0, 0, 0 };
+    ledger_segment_path(path, sizeof(path), dir, number);
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        mapped.missing = (errno == ENOENT);
+        return mapped;
+    }
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size < (off_t)sizeof(LedgerHeader)) {
+        close(fd);
+        fprintf(stderr, "bakery-ledger: %s is too short, skipped\n", path);
+        return mapped;
+    }
+    LedgerHeader *header = (LedgerHeader *)mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (header == MAP_FAILED) {
+        return mapped;
+    }
+    uint32_t count = ledger_count(header);
+    if (header->magic != LEDGER_MAGIC || (size_t)st.st_size < ledger_segment_size(header->capacity, header->slots)
+        || count > header->capacity) {
+        munmap(header, st.st_size);
+        fprintf(stderr, "bakery-ledger: %s is not a valid segment, skipped\n", path);
+        return mapped;
+    }
+    mapped.header = header;
+    mapped.size = st.st_size;
+    mapped.count = count;
+    return mapped;
+}
+
+void print_record(RecipeNames *recipes, LedgerHeader *header, LedgerRecord *record) {
+    const char *name = (record->recipe_id >= 0 && record->recipe_id < recipes->size) ? recipes->names[record->recipe_id] : "?";
+    printf("%d %d %d %s %d %d\n", header->run, record->pickup_time, record->arrival_time, name, record->quantity, record->weight);
+}
+
+// Deliveries picked up in [from, to] by the selected run (every run if run < 0): records of a segment are sorted by pickup time
+void query_time(const char *dir, RecipeNames *recipes, int run, int from, int to) {
+    for (int number = 0; ; number++) {
+        MappedSegment mapped = map_segment(dir, number);
+        if (mapped.missing) {
+            return;
+        }
+        LedgerHeader *header = mapped.header;
+        if (header == NULL) {
+            continue;
+        }
+        // each run writes its own segments, so only the header range tells if a segment can match
+        if ((run < 0 || header->run == run) && mapped.count > 0 && header->first_pickup <= to && header->last_pickup >= from) {
+            LedgerRecord *records = ledger_records(header);
+            // binary search for the first record picked up at or after from
+            int low = 0;
+            int high = mapped.count;
+            while (low < high) {
+                int mid = low + (high - low) / 2;
+                if (records[mid].pickup_time < from) {
+                    low = mid + 1;
+                } else {
+                    high = mid;
+                }
+            }
+            for (int k = low; k < (int)mapped.count && records[k].pickup_time <= to; k++) {
+                print_record(recipes, header, &records[k]);
+            }
+        }
+        munmap(header, mapped.size);
+    }
+}
+
+int compare_index(const void *a, const void *b) {
+    int32_t x = *(const int32_t *)a;
+    int32_t y = *(const int32_t *)b;
+    return (x > y) - (x < y);
+}
+
+bool has_id(const int *ids, int id_count, int32_t recipe_id) {
+    for (int k = 0; k < id_count; k++) {
+        if (ids[k] == recipe_id) {
+            return true;
+        }
+    }
+    return false;
+}
+
+// Deliveries of a recipe, under any of its ids, by the selected run: each segment is mapped once
+// and the per segment chains of the ids are followed from the recipe index
+void query_recipe(const char *dir, RecipeNames *recipes, int run, const int *ids, int id_count) {
+    for (int number = 0; ; number++) {
+        MappedSegment mapped = map_segment(dir, number);
+        if (mapped.missing) {
+            return;
+        }
+        LedgerHeader *header = mapped.header;
+        if (header == NULL) {
+            continue;
+        }
+        if (run >= 0 && header->run != run) {
+            munmap(header, mapped.size);
+            continue;
+        }
+        LedgerRecord *records = ledger_records(header);
+        int32_t *chain = (int32_t *)malloc((mapped.count + 1) * sizeof(int32_t));
+        int length = 0;
+        // index full when the segment was written, or it already points past the records published when mapped
+        bool scan = header->overflow;
+        for (int k = 0; k < id_count && !scan; k++) {
+            LedgerSlot *slot = ledger_find_slot(header, ids[k]);
+            int32_t index = (slot && slot->recipe_id == ids[k]) ? slot->last : -1;
+            if (index >= (int32_t)mapped.count) {
+                scan = true;
+                break;
+            }
+            // a chain only goes backwards, anything else is a damaged segment
+            while (index >= 0 && records[index].recipe_id == ids[k]) {
+                chain[length++] = index;
+                if (records[index].prev_recipe >= index) {
+                    break;
+                }
+                index = records[index].prev_recipe;
+            }
+        }
+        if (scan) {
+            length = 0;
+            for (int k = 0; k < (int)mapped.count; k++) {
+                if (has_id(ids, id_count, records[k].recipe_id)) {
+                    chain[length++] = k;
+                }
+            }
+        } else {
+            // chains go backwards in time, and the ids of a name interleave
+            qsort(chain, length, sizeof(int32_t), compare_index);
+        }
+        for (int k = 0; k < length; k++) {
+            print_record(recipes, header, &records[chain[k]]);
+        }
+        free(chain);
+        munmap(header, mapped.size);
+    }
+}
+
+// usage: bakery-ledger [run <n>] time <from> <to> | bakery-ledger [run <n>] recipe <name>
+// prints "run pickup_time arrival_time recipe quantity weight" per delivery, ledger directory from BAKERY_LEDGER like the engine;
+// pickup times restart with every run of the engine, "run <n>" keeps the deliveries of one run
+int main(int argc, char *argv[]) {
+    const char *dir = getenv("BAKERY_LEDGER");
+    if (dir == NULL) {
+        dir = LEDGER_DIR;
+    }
+    const char *program = argv[0];
+    int run = -1;
+    if (argc > 2 && strcmp(argv[1], "run") == 0) {
+        run = atoi(argv[2]);
+        argc -= 2;
+        argv += 2;
+    }
+    RecipeNames recipes;
+    load_recipe_names(dir, &recipes);
+    if (argc == 4 && strcmp(argv[1], "time") == 0) {
+        query_time(dir, &recipes, run, atoi(argv[2]), atoi(argv[3]));
+    } else if (argc == 3 && strcmp(argv[1], "recipe") == 0) {
+        // every id the recipes file gives the name
+        int *ids = (int *)malloc((recipes.size + 1) * sizeof(int));
+        int id_count = 0;
+        for (int recipe_id = 0; recipe_id < recipes.size; recipe_id++) {
+            if (strcmp(recipes.names[recipe_id], argv[2]) == 0) {
+                ids[id_count++] = recipe_id;
+            }
+        }
+        if (id_count > 0) {
+            query_recipe(dir, &recipes, run, ids, id_count);
+        }
+        free(ids);
+    } else {
+        fprintf(stderr, "usage: %s [run <n>] time <from> <to> | %s [run <n>] recipe <name>\n", program, program);
+        free(recipes.names);
+        return 1;
+    }
+    free(recipes.names);
+    return 0;
+}
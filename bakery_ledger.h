@@ -0,0 +1,88 @@
+#ifndef BAKERY_LEDGER_H
+#define BAKERY_LEDGER_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdatomic.h>
+
+// On disk layout of the delivery ledger written by the engine and read by bakery-ledger
+#define LEDGER_DIR "ledger"
+#define LEDGER_MAGIC 0x4c454447u // "LEDG"
+#ifndef LEDGER_SEGMENT_RECORDS
+#define LEDGER_SEGMENT_RECORDS 65536 // Records per segment file written by the engine
+#endif
+#ifndef LEDGER_RECIPE_SLOTS
+#define LEDGER_RECIPE_SLOTS 512      // Size of the recipe index of segments written by the engine
+#endif
+#define LEDGER_RECIPES_FILE "recipes" // "id name" lines, to query by recipe name
+
+// One delivered order
+typedef struct {
+    int32_t pickup_time;   // Command counter of the pickup
+    int32_t arrival_time;  // Command counter of the order
+    int32_t recipe_id;     // Ledger id of the recipe, names are in LEDGER_RECIPES_FILE
+    int32_t quantity;      // Number of desserts ordered
+    int32_t weight;        // Order weight
+    int32_t prev_recipe;   // Previous record of the same recipe in this segment, -1 if none
+} LedgerRecord;
+
+// Recipe index entry: head of the prev_recipe chain of a recipe
+typedef struct {
+    int32_t recipe_id;     // -1 if the slot is empty
+    int32_t last;          // Last record of the recipe in this segment
+} LedgerSlot;
+
+// Segment file: this header, then header.slots LedgerSlot, then header.capacity LedgerRecord
+typedef struct {
+    uint32_t magic;        // LEDGER_MAGIC
+    uint32_t capacity;     // Records the segment can hold
+    uint32_t slots;        // Entries of the recipe index
+    atomic_uint count;     // Records written in this segment, stored with release once the record is complete
+    int32_t run;           // Engine run that wrote the segment, numbered from 0, pickup times restart every run
+    uint32_t overflow;     // Recipe index full, recipe queries must scan this segment
+    int32_t first_pickup;  // Pickup time of the first record
+    int32_t last_pickup;   // Pickup time of the last record, records are sorted by pickup time
+} LedgerHeader;
+
+// Records a reader may look at: everything below count was written before count was published
+static inline uint32_t ledger_count(LedgerHeader *header) {
+    return atomic_load_explicit(&header->count, memory_order_acquire);
+}
+
+// Bytes of a segment file holding capacity records and slots index entries
+static inline size_t ledger_segment_size(uint32_t capacity, uint32_t slots) {
+    return sizeof(LedgerHeader) + (size_t)slots * sizeof(LedgerSlot) + (size_t)capacity * sizeof(LedgerRecord);
+}
+
+// Recipe index of a mapped segment, open addressing on recipe_id
+static inline LedgerSlot *ledger_slots(LedgerHeader *header) {
+    return (LedgerSlot *)(header + 1);
+}
+
+static inline LedgerRecord *ledger_records(LedgerHeader *header) {
+    return (LedgerRecord *)(ledger_slots(header) + header->slots);
+}
+
+// Path of a segment file, segments are numbered from 0
+static inline void ledger_segment_path(char *path, size_t size, const char *dir, int segment) {
+    snprintf(path, size, "%s/segment-%06d.dat", dir, segment);
+}
+
+// Slot of a recipe in the segment index, or of the empty slot where it would go, NULL if the index is full
+static inline LedgerSlot *ledger_find_slot(LedgerHeader *header, int32_t recipe_id) {
+    LedgerSlot *slots = ledger_slots(header);
+    if (header->slots == 0) {
+        return NULL;
+    }
+    unsigned int index = (unsigned int)recipe_id % header->slots;
+    for (unsigned int probe = 0; probe < header->slots; probe++) {
+        LedgerSlot *slot = &slots[index];
+        if (slot->recipe_id == recipe_id || slot->recipe_id == -1) {
+            return slot;
+        }
+        index = (index + 1) % header->slots;
+    }
+    return NULL;
+}
+
+#endif
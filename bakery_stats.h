@@ -0,0 +1,60 @@
+#ifndef BAKERY_STATS_H
+#define BAKERY_STATS_H
+
+#include <stdint.h>
+#include <stdatomic.h>
+#include <errno.h>
+#include <signal.h>
+#include <sys/types.h>
+
+// Shared memory segment published by the engine and read by bakery-top,
+// both take its name (e.g. /bakery-stats) from the BAKERY_STATS_SHM environment variable
+#define STATS_MAGIC 0x42414b45u // "BAKE"
+
+// Counters and gauges of the engine, updated once per command
+typedef struct {
+    uint64_t command;            // Command counter i
+    uint64_t waiting_orders;     // Length of the waiting queue
+    uint64_t ready_orders;       // Length of the ready queue
+    uint64_t batches;            // Batches currently stored in the warehouse
+    uint64_t expired_batches;    // Expired batches purged so far
+    uint64_t recipes;            // Recipes in the catalog
+    uint64_t ingredients;        // Ingredients in the warehouse
+    uint64_t last_pickup_orders; // Orders loaded by the last pickup
+    uint64_t last_pickup_weight; // Weight loaded by the last pickup
+} BakeryStats;
+
+typedef struct {
+    uint32_t magic;    // STATS_MAGIC once the segment is initialized
+    atomic_uint seq;   // Seqlock sequence, odd while the engine is writing
+    int32_t owner;     // Pid of the engine publishing on the segment
+    BakeryStats stats;
+} StatsSegment;
+
+// A segment whose owner is gone was left behind by an engine that didn't exit normally
+static inline int stats_owner_alive(const StatsSegment *segment) {
+    return kill((pid_t)segment->owner, 0) == 0 || errno == EPERM;
+}
+
+// Writer side: the engine is the only writer, so it never waits
+static inline void stats_publish(StatsSegment *segment, const BakeryStats *stats) {
+    unsigned int seq = atomic_load_explicit(&segment->seq, memory_order_relaxed);
+    atomic_store_explicit(&segment->seq, seq + 1, memory_order_relaxed);
+    atomic_thread_fence(memory_order_release);
+    segment->stats = *stats;
+    atomic_store_explicit(&segment->seq, seq + 2, memory_order_release);
+}
+
+// Reader side: retry until a copy was taken while no write was in progress
+static inline void stats_snapshot(StatsSegment *segment, BakeryStats *stats) {
+    unsigned int before;
+    unsigned int after;
+    do {
+        before = atomic_load_explicit(&segment->seq, memory_order_acquire);
+        *stats = segment->stats;
+        atomic_thread_fence(memory_order_acquire);
+        after = atomic_load_explicit(&segment->seq, memory_order_relaxed);
+    } while ((before & 1) || before != after);
+}
+
+#endif
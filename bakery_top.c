@@ -0,0 +1,60 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include "bakery_stats.h"
+
+// Print the engine stats every interval seconds, count times (forever if count is 0)
+// usage: BAKERY_STATS_SHM=<name> bakery-top [interval [count]], the same name the engine was started with
+int main(int argc, char *argv[]) {
+    int interval = argc > 1 ? atoi(argv[1]) : 1;
+    int count = argc > 2 ? atoi(argv[2]) : 0;
+    if (interval <= 0) {
+        interval = 1;
+    }
+    const char *name = getenv("BAKERY_STATS_SHM");
+    if (name == NULL) {
+        fprintf(stderr, "bakery-top: set BAKERY_STATS_SHM to the segment name given to the engine\n");
+        return 1;
+    }
+    // read only mapping, the engine never waits for us
+    int fd = shm_open(name, O_RDONLY, 0);
+    if (fd < 0) {
+        fprintf(stderr, "bakery-top: no engine publishing on %s\n", name);
+        return 1;
+    }
+    StatsSegment *segment = (StatsSegment *)mmap(NULL, sizeof(StatsSegment), PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (segment == MAP_FAILED || segment->magic != STATS_MAGIC) {
+        fprintf(stderr, "bakery-top: %s is not a stats segment\n", name);
+        return 1;
+    }
+    if (!stats_owner_alive(segment)) {
+        fprintf(stderr, "bakery-top: engine %d publishing on %s is gone, stats are stale\n", (int)segment->owner, name);
+        munmap(segment, sizeof(StatsSegment));
+        return 1;
+    }
+    printf("%10s %8s %8s %8s %8s %8s %8s %8s %10s\n", "command", "waiting", "ready", "batches", "expired", "recipes", "ingr", "picked", "weight");
+    for (int n = 0; count == 0 || n < count; n++) {
+        if (n > 0) {
+            sleep(interval);
+        }
+        BakeryStats stats;
+        stats_snapshot(segment, &stats);
+        printf("%10llu %8llu %8llu %8llu %8llu %8llu %8llu %8llu %10llu\n",
+               (unsigned long long)stats.command, (unsigned long long)stats.waiting_orders,
+               (unsigned long long)stats.ready_orders, (unsigned long long)stats.batches,
+               (unsigned long long)stats.expired_batches, (unsigned long long)stats.recipes,
+               (unsigned long long)stats.ingredients, (unsigned long long)stats.last_pickup_orders,
+               (unsigned long long)stats.last_pickup_weight);
+        fflush(stdout);
+        if (!stats_owner_alive(segment)) {
+            // the values would stay frozen from now on
+            printf("engine %d exited\n", (int)segment->owner);
+            break;
+        }
+    }
+    munmap(segment, sizeof(StatsSegment));
+    return 0;
+}